@@ -20,6 +20,7 @@ Cache initializeCache(size_t capacity)
     ORG.putSize =0;
     ORG.getSize = 0;
     ORG.cap = capacity;
+    ORG.appendOnly = false;
     ORG.putHead = initNode("PUT HEAD NODE", NULL, 0,0,0);
     ORG.putTail = initNode("PUT TAIL NODE", NULL, 0,0,0);
     ORG.putHead->next = ORG.putTail;
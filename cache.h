@@ -17,6 +17,7 @@ struct cache {
     size_t putSize;
     size_t getSize;
     size_t cap;
+    bool appendOnly; /* files only grow: a grown file is read from its old end */
     Node putHead, putTail;
     Node getHead, getTail;
 };
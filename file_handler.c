@@ -1,7 +1,9 @@
 #include "file_handler.h"
 
-const char *output = "_output";
-const char connector = '.';
+/* bytes before the old end of file compared before trusting an append */
+#define APPEND_CHECK 64
+
+void refreshNode(Node target, char *contentKey, int maxAge, float entryTime, bool appendOnly);
 
 /* parseCommand 
  * purpose: process the command line string to execute target operation on 
@@ -10,27 +12,71 @@ const char connector = '.';
  * return: None
  * parameter: 
  *      cmd: string consisting of commands 
+ *      stage: write-behind stage receiving the output of GET commands
  */
-void parseCommand(Cache_T ORG, char *cmd, Time systemTime)
+void parseCommand(Cache_T ORG, char *cmd, Time systemTime, OutputStage stage)
+{
+    int maxAge;
+    char *filename;
+    clock_gettime(CLOCK_MONOTONIC, systemTime);
+    if (splitCommand(cmd, &filename, &maxAge) == 'P') { /* PUT command */
+        handlePut(ORG, filename, maxAge, (float)systemTime->tv_nsec);
+    } else { /* GET command */
+        handleGet(ORG, filename, (float)systemTime->tv_nsec, stage);
+    }
+}
+
+/* parseSharedCommand 
+ * purpose: process the command line string to execute target operation on 
+ *          a shared memory cache segment
+ * prereq: command is either PUT or GET
+ * return: None
+ * parameter: 
+ *      SC: cache segment shared with other processes
+ *      cmd: string consisting of commands 
+ *      stage: write-behind stage receiving the output of GET commands
+ */
+void parseSharedCommand(SharedCache SC, char *cmd, Time systemTime, OutputStage stage)
 {
-    assert(cmd[0] == 'P' || cmd[0] == 'G');
     int maxAge;
-    char *filename, *save, *intermediate; 
+    char *filename;
     clock_gettime(CLOCK_MONOTONIC, systemTime);
+    if (splitCommand(cmd, &filename, &maxAge) == 'P') { /* PUT command */
+        handleSharedPut(SC, filename, maxAge, (float)systemTime->tv_nsec);
+    } else { /* GET command */
+        getShared(SC, filename, (float)systemTime->tv_nsec, stage);
+    }
+}
+
+/* splitCommand 
+ * purpose: locate the target file name and maxAge in a command line 
+ * prereq: command is either PUT or GET
+ * return: 'P' for a PUT command, 'G' for a GET command 
+ * parameter: 
+ *      cmd: string consisting of commands, split in place
+ *      fileName: set to the target file name inside cmd
+ *      maxAge: set to the maxAge of a PUT command, 0 for GET
+ */
+char splitCommand(char *cmd, char **fileName, int *maxAge)
+{
+    assert(cmd[0] == 'P' || cmd[0] == 'G');
+    char *filename, *intermediate, *position; 
+    *maxAge = 0;
     if (cmd[0] == 'P') { /* PUT command */
         char * save = calloc(strlen(cmd)+1, sizeof(char));
         strcpy(save, cmd);
-        filename = strtok(cmd, "PUT: ");
-        filename = strtok(filename, "\\");
+        filename = strtok_r(cmd, "PUT: ", &position);
+        filename = strtok_r(filename, "\\", &position);
         filename[strlen(filename)] = '\0';
         intermediate = strchr(save, 'M');
-        maxAge = atoi(intermediate += 8);
+        *maxAge = atoi(intermediate += 8);
         free(save);
-        handlePut(ORG, filename, maxAge, (float)systemTime->tv_nsec);
-    } else { /* GET command */
-        filename = cmd + 5;
-        handleGet(ORG, filename, (float)systemTime->tv_nsec);
+        *fileName = filename;
+        return 'P';
     }
+    /* GET command */
+    *fileName = cmd + 5;
+    return 'G';
 }
 
 /* handlePut
@@ -45,26 +91,107 @@ void parseCommand(Cache_T ORG, char *cmd, Time systemTime)
 void handlePut(Cache_T ORG, char *contentKey, int maxAge, float entryTime)
 {
     assert(contentKey != NULL);
-    void *fileContent = NULL; // free and handled by freeNode
-    size_t contentSize = readTargetFile(contentKey, &fileContent);
     /* check if the nodes are present in either list */
     Node node_add = findNode(ORG, contentKey);
     if (node_add != NULL) {
-        updateNode(node_add, fileContent, maxAge, contentSize, entryTime);
+        refreshNode(node_add, contentKey, maxAge, entryTime, ORG->appendOnly);
         movetoHead(ORG->putHead, node_add);
     } else {
+        struct stat info;
+        void *fileContent = NULL; // free and handled by freeNode
+        size_t contentSize = readTargetFileFrom(contentKey, 0, &fileContent, &info);
         if (shouldEvict(ORG)){ /* check if full cache */
             evictCache(ORG, entryTime);
         }
         /* new insertion for absent filenode */
         node_add = initNode(contentKey, fileContent, maxAge, entryTime, contentSize);
+        setNodeStamp(node_add, &info);
         putNewNode(ORG->putHead, node_add);
         ORG->putSize ++;
     }
 
 }
 
-void handleGet(Cache_T ORG, char *contentKey, float entryTime)
+/* refreshNode
+ * purpose: bring the content of a node that is PUT again up to date with 
+ *          its file, reading only what changed
+ *          unchanged file -> keep the content, no read
+ *          grown file of an append only cache -> read the new tail only
+ *          otherwise      -> read the entire file again
+ * prereq: target is the node of contentKey
+ * return: None 
+ * parameter:
+ *      target: node already cached for contentKey
+ *      contentKey: string representing the file name/path
+ *      maxAge: integer represents the time to live of a file
+ *      entryTime: CPU seconds elapsed since program started
+ *      appendOnly: caller guarantees files are only ever appended to; a
+ *                  file rewritten in place would leave stale content
+ */
+void refreshNode(Node target, char *contentKey, int maxAge, float entryTime, bool appendOnly)
+{
+    struct stat info;
+    void *fileContent = NULL; // free and handled by freeNode
+    bool present = stat(contentKey, &info) == 0;
+    if (present && stampMatches(target, &info)) {
+        renewNode(target, maxAge, entryTime);
+        return;
+    }
+    if (appendOnly && present && isAppended(target, &info)) {
+        /* cheap guard against a truncated and regrown file; it cannot
+           detect changes earlier in the file */
+        size_t overlap = target->contentSize < APPEND_CHECK ? target->contentSize : APPEND_CHECK;
+        size_t offset = target->contentSize - overlap;
+        size_t readSize = readTargetFileFrom(contentKey, offset, &fileContent, &info);
+        if (fileContent != NULL && readSize > overlap &&
+            memcmp(fileContent, (char *)target->fileContent + offset, overlap) == 0) {
+            appendNodeContent(target, (char *)fileContent + overlap, readSize - overlap);
+            setNodeStamp(target, &info);
+            renewNode(target, maxAge, entryTime);
+            free(fileContent);
+            return;
+        }
+        free(fileContent);
+        fileContent = NULL;
+    }
+    size_t contentSize = readTargetFileFrom(contentKey, 0, &fileContent, &info);
+    updateNode(target, fileContent, maxAge, contentSize, entryTime);
+    setNodeStamp(target, &info);
+}
+
+/* handleSharedPut
+ * purpose: handle a PUT operation to a shared memory cache segment
+ * preqreq: targetFile is a legal file name
+ * return: None 
+ * parameter:
+ *      SC: cache segment shared with other processes
+ *      targetFile: string representing the file name/path
+ *      maxAge: integer represents the time to live of a file
+ *      entryTime: CPU seconds elapsed since program started
+ */
+void handleSharedPut(SharedCache SC, char *contentKey, int maxAge, float entryTime)
+{
+    assert(contentKey != NULL);
+    struct stat info;
+    /* unchanged file already in the segment: nothing to read */
+    if (stat(contentKey, &info) == 0 && 
+        renewShared(SC, contentKey, &info, maxAge, entryTime)) return;
+    void *fileContent = NULL;
+    size_t contentSize = readTargetFileFrom(contentKey, 0, &fileContent, &info);
+    putShared(SC, contentKey, fileContent, contentSize, &info, maxAge, entryTime);
+    free(fileContent);
+}
+
+/* handleGet
+ * purpose: handle a GET operation to cache
+ * preqreq: targetFile is a legal file name
+ * return: None
+ * parameter:
+ *      targetFile: string representing the file name/path
+ *      entryTime: CPU seconds elapsed since program started
+ *      stage: write-behind stage that writes the output file
+ */
+void handleGet(Cache_T ORG, char *contentKey, float entryTime, OutputStage stage)
 {
     assert(contentKey != NULL);
     Node node_add = findNode(ORG, contentKey);
@@ -79,69 +206,55 @@ void handleGet(Cache_T ORG, char *contentKey, float entryTime)
         node_add->entryTime = entryTime; /* update initialStorage time of the 
         existing node ONLY if it is stale */ 
     }
-    /* overwrite and output updated content to the output file */
-    writeTargetFile(node_add->fileName, node_add->fileContent, node_add->contentSize);
+    /* queue updated content for the output file; unchanged content is not
+       written again */
+    submitOutput(stage, node_add->fileName, node_add->fileContent,
+                 node_add->contentSize, node_add->generation);
 }
 
 
-/* readTargetFile 
- * purpose: open the target file and read in the entire file information 
+/* readTargetFileFrom 
+ * purpose: open the target file and read in the file information from
+ *          offset up to its end
  * prereq: None 
- * return: the total number of bytes read from the target file 
+ * return: the total number of bytes read from the target file; address is
+ *         left untouched when the file cannot be opened or has no bytes
+ *         past offset
  * parameter: 
  *      fileName: a valid pathname of address string 
+ *      offset: first byte of the file to read
+ *      info: filled with the fstat of the file that was read, zeroed
+ *            when it cannot be opened
 */
-size_t readTargetFile(char *fileName, void **address){
-    struct stat buffer;
+size_t readTargetFileFrom(char *fileName, size_t offset, void **address, struct stat *info){
+    memset(info, 0, sizeof(struct stat));
     int fd2 = open(fileName, O_RDONLY);
     if (fd2 < 0) {
         fprintf(stderr, "corrupted file \n");
         return 0;
     }
     /* accessing file size information */
-    fstat(fd2, &buffer);
-    size_t fileSize = buffer.st_size;
+    fstat(fd2, info);
+    size_t fileSize = info->st_size;
+    if (offset > 0 && fileSize <= offset) {
+        close(fd2);
+        return 0;
+    }
     /* malloc size of filecontent */
-    void *fileContent = malloc(sizeof(char) * fileSize);
-    /* read in entire file content */
-    read(fd2, fileContent,fileSize);
-    *address = fileContent;
-    return fileSize;
-}
-
-/* writeTargetFile 
- * purpose: open the target output file pipe and output all contents 
- *          to the target file source 
- * prereq: None 
- * return: status of the write process: -1 on failure, 0 on success 
- * parameter: 
- *      fileName: a valid pathname of address string 
- *      content: data stored in the cache associated with the target file
- *      contentSize: total number of bytes that should be output into file
-*/
-int writeTargetFile(char *fileName, void *content, size_t contentSize)
-{ 
-    char *extension = strchr(fileName, connector);
-    char *outputName = calloc(strlen(fileName) + strlen(output) + 1, sizeof(char));
-    if(extension == NULL){
-        strcpy(outputName, fileName);
-        strcat(outputName, output); 
-    } else {
-        int index = 0;
-        while(fileName[index++] != extension[0]){}
-        strncpy(outputName, fileName, --index);
-        strcat(outputName, output);
-        strcat(outputName, extension);
+    void *fileContent = malloc(sizeof(char) * (fileSize - offset));
+    /* read in file content past offset */
+    size_t numBytes = 0;
+    while (numBytes < fileSize - offset) {
+        ssize_t readBytes = pread(fd2, (char *)fileContent + numBytes,
+                                  fileSize - offset - numBytes, offset + numBytes);
+        if (readBytes <= 0) break;
+        numBytes += readBytes;
     }
-    int fd3 = open(outputName, O_WRONLY | O_CREAT, 0666);
-    if (fd3 == -1) return fd3;
-    if(write(fd3, content, contentSize) < 0) return -1;
-    free(outputName);
-    close(fd3);
-    return 0;
+    close(fd2);
+    *address = fileContent;
+    return numBytes;
 }
 
-
 /* readaLine
  * purpose: read the opened file line by line to attain the instructions 
  * prereq: file descriptor is created and opened 
@@ -12,16 +12,20 @@
 #include <unistd.h> 
 #include "cache.h"
 #include "file_node.h"
+#include "output_stage.h"
+#include "shared_cache.h"
 
 typedef struct timespec* Time;
 
 size_t readaLine(int fileDescriptor, char **instructions);
-size_t readTargetFile(char *fileName, void **address);
-int writeTargetFile(char *fileName, void *content, size_t contentSize);
+size_t readTargetFileFrom(char *fileName, size_t offset, void **address, struct stat *info);
 
-void parseCommand(Cache_T ORG, char *cmd, Time systemTime);
+void parseCommand(Cache_T ORG, char *cmd, Time systemTime, OutputStage stage);
+void parseSharedCommand(SharedCache SC, char *cmd, Time systemTime, OutputStage stage);
+char splitCommand(char *cmd, char **fileName, int *maxAge);
 void handlePut(Cache_T ORG, char *contentKey, int maxAge, float entryTime);
-void handleGet(Cache_T ORG, char *contentKey, float entryTime);
+void handleGet(Cache_T ORG, char *contentKey, float entryTime, OutputStage stage);
+void handleSharedPut(SharedCache SC, char *contentKey, int maxAge, float entryTime);
 
 
 int deleteTargetFile(char *targetFileName);
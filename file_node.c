@@ -1,5 +1,9 @@
 #include "file_node.h"
 
+/* last content generation handed out; never 0 so that 0 means "none",
+ * shared by the caches of all replay workers */
+static unsigned long lastGeneration = 0;
+
 /* initNode 
  * purpose: construct a node class on heap memory and return pointer
  *          to the existing object 
@@ -10,6 +14,7 @@
  *          inputContent: the bytes of contents associated with contentKey
  *          maxAge: maximum age to live for the present file
  *          entryTime: initial storage time of the file          
+ * notes: every node starts with a fresh content generation
  */
 
 Node initNode(char *name, void *inputContent, int maxAge, float entryTime, size_t contentSize)
@@ -22,6 +27,8 @@ Node initNode(char *name, void *inputContent, int maxAge, float entryTime, size_
     prod->maxAge = maxAge;
     prod->retrieved = false;
     prod->contentSize = contentSize;
+    prod->generation = __atomic_add_fetch(&lastGeneration, 1, __ATOMIC_RELAXED);
+    memset(&prod->stamp, 0, sizeof(FileStamp));
     prod->prev = NULL;
     prod->next = NULL;
     return prod;
@@ -91,6 +98,71 @@ void setNodeRetrieved(Node curr)
     curr->retrieved = true;
 }
 
+/* makeStamp 
+ * purpose: record device, inode, size and modification time of a file
+ * preq-req: info was filled by stat/fstat on the file
+*/
+void makeStamp(FileStamp *stamp, struct stat *info)
+{
+    assert(stamp != NULL && info != NULL);
+    stamp->device = info->st_dev;
+    stamp->inode = info->st_ino;
+    stamp->size = info->st_size;
+    stamp->modified = info->st_mtim;
+}
+
+/* sameStamp 
+ * purpose: check if a file still is the version recorded in stamp
+ * preq-req: info was filled by stat/fstat on the file
+ * return: True if device, inode, size and modification time are unchanged
+*/
+bool sameStamp(FileStamp *stamp, struct stat *info)
+{
+    assert(stamp != NULL && info != NULL);
+    return stamp->device == info->st_dev &&
+           stamp->inode == info->st_ino &&
+           stamp->size == info->st_size &&
+           stamp->modified.tv_sec == info->st_mtim.tv_sec &&
+           stamp->modified.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+/* setNodeStamp 
+ * purpose: record which version of the file the node content was read from
+ * preq-req: info was filled by stat/fstat on the node's file
+*/
+void setNodeStamp(Node target, struct stat *info)
+{
+    assert(target != NULL);
+    makeStamp(&target->stamp, info);
+}
+
+/* stampMatches 
+ * purpose: check if the file still is the version the node content holds
+ * preq-req: info was filled by stat/fstat on the node's file
+ * return: True if device, inode, size and modification time are unchanged
+*/
+bool stampMatches(Node target, struct stat *info)
+{
+    assert(target != NULL);
+    return sameStamp(&target->stamp, info);
+}
+
+/* isAppended 
+ * purpose: check if the file may only have grown since the node content
+ *          was read, so that reading the new tail is enough
+ * preq-req: info was filled by stat/fstat on the node's file
+ * return: True if it is the same file, now larger, and the node holds
+ *         the complete old content
+*/
+bool isAppended(Node target, struct stat *info)
+{
+    assert(target != NULL && info != NULL);
+    return target->stamp.device == info->st_dev &&
+           target->stamp.inode == info->st_ino &&
+           target->stamp.size == (off_t)target->contentSize &&
+           info->st_size > target->stamp.size;
+}
+
 /* movetoHead 
  * purpose: remove a node from its original list and place the node into 
  *          the head of another list, update the Node with this entryTime
@@ -103,6 +175,8 @@ Node movetoHead(Node head, Node target)
     void *newContent = malloc(target->contentSize);
     memcpy(newContent, target->fileContent, target->contentSize);
     Node curr = initNode(target->fileName, newContent, target->maxAge, target->entryTime, target->contentSize);
+    curr->generation = target->generation; /* same content, same generation */
+    curr->stamp = target->stamp;
     removeNode(target);
     putNewNode(head, curr);
     return curr;
@@ -123,6 +197,7 @@ void popTail(Node tail)
 /* updateNode
  * purpose: update a target node's certain field with new value
  * use case: a file node is PUT again and with new content and information
+ * notes: the new content gets a new generation
 */
 void updateNode(Node target, void *content, int maxAge, size_t contentSize, float entryTime)
 {
@@ -131,6 +206,32 @@ void updateNode(Node target, void *content, int maxAge, size_t contentSize, floa
     target->maxAge = maxAge;
     target->contentSize = contentSize;
     target->entryTime = entryTime;
+    target->generation = __atomic_add_fetch(&lastGeneration, 1, __ATOMIC_RELAXED);
+}
+
+/* renewNode
+ * purpose: update a target node's policy fields while keeping its content
+ * use case: a file node is PUT again but the file did not change
+*/
+void renewNode(Node target, int maxAge, float entryTime)
+{
+    target->maxAge = maxAge;
+    target->entryTime = entryTime;
+}
+
+/* appendNodeContent
+ * purpose: extend the content of a target node with the bytes of tail
+ * use case: a file node is PUT again after its file was appended to
+ * notes: the extended content gets a new generation
+*/
+void appendNodeContent(Node target, void *tail, size_t tailSize)
+{
+    void *content = realloc(target->fileContent, target->contentSize + tailSize);
+    assert(content != NULL);
+    memcpy((char *)content + target->contentSize, tail, tailSize);
+    target->fileContent = content;
+    target->contentSize += tailSize;
+    target->generation = __atomic_add_fetch(&lastGeneration, 1, __ATOMIC_RELAXED);
 }
 
 /* BELOW HELPER FUNCTION TO BE CLEANED UP AND REMVOED LATER  */
@@ -15,6 +15,15 @@
 #include <unistd.h> 
 
 typedef struct linkedNode* Node;
+typedef struct fileStamp FileStamp;
+
+/* identity and version of the file a node's content was read from */
+struct fileStamp {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+};
 
 struct linkedNode{
     char *fileName;
@@ -23,6 +32,8 @@ struct linkedNode{
     int maxAge;
     bool retrieved;
     size_t contentSize;
+    unsigned long generation;
+    FileStamp stamp;
     Node prev;
     Node next;
 };
@@ -31,6 +42,13 @@ struct linkedNode{
 Node initNode(char *name, void *inputContent, int maxAge, float entryTime, size_t contentSize);
 void freeNode(Node target);
 void setNodeRetrieved(Node curr);
+void makeStamp(FileStamp *stamp, struct stat *info);
+bool sameStamp(FileStamp *stamp, struct stat *info);
+void setNodeStamp(Node target, struct stat *info);
+bool stampMatches(Node target, struct stat *info);
+bool isAppended(Node target, struct stat *info);
+void renewNode(Node target, int maxAge, float entryTime);
+void appendNodeContent(Node target, void *tail, size_t tailSize);
 void putNewNode(Node head, Node node_ptr);
 void removeNode(Node node_ptr);
 void freeLinkedlist(Node head);
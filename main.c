@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <fcntl.h> 
@@ -9,16 +10,69 @@
 #include "cache.h"
 #include "file_handler.h"
 #include "file_node.h"
+#include "output_stage.h"
+#include "shared_cache.h"
+#include "replay.h"
+
+size_t parseCount(char *text, char *what);
 
 
 int main(int argc, char *argv[])
 {
+    /* optional shared memory segment, see shared_cache.h */
+    char *segmentName = NULL;
+    size_t slotBytes = SHARED_SLOT_BYTES;
+    /* optional parallel replay, see replay.h */
+    int workers = 0;
+    double sampleRate = REPLAY_SAMPLE_RATE;
+    /* grown files are read from their old end, see refreshNode */
+    bool appendOnly = false;
+    int option;
+    while ((option = getopt(argc, argv, "as:b:j:r:")) != -1) {
+        if (option == 'a') {
+            appendOnly = true;
+        } else if (option == 's') {
+            segmentName = optarg;
+        } else if (option == 'b') {
+            slotBytes = parseCount(optarg, "-b bytes per file");
+        } else if (option == 'j') {
+            size_t threads = parseCount(optarg, "-j thread count");
+            if (threads > REPLAY_MAX_WORKERS) {
+                fprintf(stderr, "-j allows at most %d threads \n", REPLAY_MAX_WORKERS);
+                exit(1);
+            }
+            workers = threads;
+        } else if (option == 'r') {
+            sampleRate = atof(optarg);
+        } else {
+            exit(1);
+        }
+    }
+    argv += optind - 1;
+    argc -= optind - 1;
     if (argc <= 2){
         fprintf(stderr, "Insufficient argument; please follow format \n\
-        ./a.out <text file name> <cache size> \n");
+        ./a.out [-a] <text file name> <cache size> \n\
+        ./a.out -s <segment name> [-b <bytes per file>] <text file name> <cache size> \n\
+        ./a.out [-a] -j <threads> [-r <sample rate>] <text file name> <cache size> \n");
+        exit(1);
+    }
+    size_t capacity = parseCount(argv[2], "cache size");
+    if (sampleRate <= 0 || sampleRate > 1 ||
+        (segmentName != NULL && (workers > 0 || appendOnly))) {
+        fprintf(stderr, "-r needs a rate in (0, 1], \n\
+        and -j or -a cannot be combined with -s \n");
         exit(1);
     }
 
+    if (workers > 0) { /* parallel replay with per-thread caches */
+        OutputStage stage = initOutputStage();
+        int status = replayParallel(argv[1], capacity, workers, sampleRate,
+                                    appendOnly, stage);
+        closeOutputStage(stage);
+        return (status < 0) ? 1 : 0;
+    }
+
     /* track system time since clock begins */
     struct timespec trackTime = {0, 0}; 
     
@@ -31,18 +85,31 @@ int main(int argc, char *argv[])
     }
 
     /* initialize Cache structure */
-    char *totalSize = argv[2];
-    Cache target = initializeCache(atoi(totalSize));
+    Cache target = initializeCache(capacity);
+    target.appendOnly = appendOnly;
+    SharedCache shared = NULL;
+    if (segmentName != NULL) {
+        shared = openSharedCache(segmentName, capacity, slotBytes);
+        if (shared == NULL) exit(1);
+    }
+    /* output files of GET commands are written in the background */
+    OutputStage stage = initOutputStage();
 
     /* read cmd file to process command */
     char *command = NULL;
     int status = readaLine(fd1, &command);
     while (status != 0){ /* not reaching the eof */
-        parseCommand(&target, command, &trackTime);
+        if (shared != NULL) {
+            parseSharedCommand(shared, command, &trackTime, stage);
+        } else {
+            parseCommand(&target, command, &trackTime, stage);
+        }
         free(command); /* free ptr for next iteration */
         status = readaLine(fd1, &command);
     }
     free(command);
+    closeOutputStage(stage);
+    if (shared != NULL) closeSharedCache(shared);
     cleanCache(target);
     /* close file here */
     if(close(fd1) < 0){
@@ -52,3 +119,24 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+/* parseCount
+ * purpose: read a positive decimal number from a command line argument
+ * prereq: None
+ * return: the number; exits the program if text is not a positive 
+ *         number that fits in a size_t
+ * parameter:
+ *      text: the command line argument
+ *      what: description of the argument for the error message
+ */
+size_t parseCount(char *text, char *what)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (strchr(text, '-') != NULL || end == text || *end != '\0' ||
+        errno != 0 || value == 0 || value > SIZE_MAX) {
+        fprintf(stderr, "%s must be a positive number, not \"%s\" \n", what, text);
+        exit(1);
+    }
+    return value;
+}
@@ -0,0 +1,293 @@
+#include "output_stage.h"
+
+const char *outputSuffix = "_output";
+const char outputConnector = '.';
+
+static void *flushOutputs(void *arg);
+static int flushSlot(OutputSlot *slot, void *content, size_t contentSize);
+static OutputSlot *findSlot(OutputStage stage, char *fileName);
+static OutputSlot *claimSlot(OutputStage stage, char *fileName);
+static OutputSlot *lockSlot(OutputStage stage, char *fileName);
+static void queueLocked(OutputStage stage, OutputSlot *slot, void *buffer,
+                        size_t contentSize, unsigned long generation);
+
+
+/* initOutputStage
+ * purpose: construct the write-behind stage on heap memory and start the
+ *          background thread that flushes pending output files
+ * prereq: None
+ * return: pointer to an initialized outputStage object
+ */
+OutputStage initOutputStage(void)
+{
+    OutputStage stage = calloc(1, sizeof(struct outputStage));
+    assert(stage != NULL);
+    for (int i = 0; i < OUTPUT_SLOTS; i++) stage->slots[i].fd = -1;
+    pthread_mutex_init(&stage->lock, NULL);
+    pthread_cond_init(&stage->work, NULL);
+    pthread_cond_init(&stage->drained, NULL);
+    int status = pthread_create(&stage->flusher, NULL, flushOutputs, stage);
+    assert(status == 0);
+    return stage;
+}
+
+/* closeOutputStage
+ * purpose: flush every pending output, stop the background thread and
+ *          release all descriptors and heap memory of the stage
+ * prereq: stage is initialized and no other thread submits to it anymore
+ * return: None
+ * parameter:
+ *      stage: an initialized outputStage object
+ */
+void closeOutputStage(OutputStage stage)
+{
+    assert(stage != NULL);
+    pthread_mutex_lock(&stage->lock);
+    stage->stopping = true;
+    pthread_cond_signal(&stage->work);
+    pthread_mutex_unlock(&stage->lock);
+    pthread_join(stage->flusher, NULL);
+    for (int i = 0; i < OUTPUT_SLOTS; i++) {
+        OutputSlot *slot = &stage->slots[i];
+        if (slot->fd >= 0) close(slot->fd);
+        free(slot->fileName);
+        free(slot->outputName);
+    }
+    pthread_cond_destroy(&stage->drained);
+    pthread_cond_destroy(&stage->work);
+    pthread_mutex_destroy(&stage->lock);
+    free(stage);
+}
+
+/* submitOutput
+ * purpose: queue the content of a retrieved file for its output file; the
+ *          write is skipped when this generation was already queued, and a
+ *          newer generation replaces one that has not been flushed yet
+ * prereq: generation changes whenever the content of the file changes
+ * return: 0 when queued or collapsed, -1 on failure
+ * parameter:
+ *      fileName: a valid pathname of address string
+ *      content: data stored in the cache associated with the target file
+ *      contentSize: total number of bytes that should be output into file
+ *      generation: content generation of the cache node
+ * notes: the content is copied without holding the stage lock
+ */
+int submitOutput(OutputStage stage, char *fileName, void *content,
+                 size_t contentSize, unsigned long generation)
+{
+    assert(stage != NULL && fileName != NULL);
+    if (isQueued(stage, fileName, generation)) return 0; /* identical rewrite */
+    void *copy = malloc(contentSize > 0 ? contentSize : 1);
+    if (copy == NULL) return -1;
+    memcpy(copy, content, contentSize);
+    return submitOwnedOutput(stage, fileName, copy, contentSize, generation);
+}
+
+/* submitOwnedOutput
+ * purpose: same as submitOutput for a content buffer the caller already
+ *          copied; the stage takes it over instead of copying it again
+ * prereq: buffer is heap allocated and not used by the caller afterwards
+ * return: 0 when queued or collapsed
+ */
+int submitOwnedOutput(OutputStage stage, char *fileName, void *buffer,
+                      size_t contentSize, unsigned long generation)
+{
+    assert(stage != NULL && fileName != NULL && buffer != NULL);
+    OutputSlot *slot = lockSlot(stage, fileName);
+    if (slot->lastGeneration == generation) { /* identical rewrite */
+        pthread_mutex_unlock(&stage->lock);
+        free(buffer);
+        return 0;
+    }
+    queueLocked(stage, slot, buffer, contentSize, generation);
+    pthread_mutex_unlock(&stage->lock);
+    return 0;
+}
+
+/* isQueued
+ * purpose: check if a content generation of fileName was already handed
+ *          to the stage, so the caller can skip building its buffer
+ * return: True if submitting this generation again would be collapsed
+ */
+bool isQueued(OutputStage stage, char *fileName, unsigned long generation)
+{
+    assert(stage != NULL && fileName != NULL);
+    pthread_mutex_lock(&stage->lock);
+    OutputSlot *slot = findSlot(stage, fileName);
+    bool queued = slot != NULL && slot->lastGeneration == generation;
+    pthread_mutex_unlock(&stage->lock);
+    return queued;
+}
+
+/* makeOutputName
+ * purpose: build the name of the output file for a target file by placing
+ *          "_output" in front of its extension
+ * prereq: None
+ * return: heap allocated output file name, freed by the caller
+ * parameter:
+ *      fileName: a valid pathname of address string
+ */
+char *makeOutputName(char *fileName)
+{
+    char *extension = strchr(fileName, outputConnector);
+    char *outputName = calloc(strlen(fileName) + strlen(outputSuffix) + 1, sizeof(char));
+    assert(outputName != NULL);
+    if (extension == NULL) {
+        strcpy(outputName, fileName);
+        strcat(outputName, outputSuffix);
+    } else {
+        strncpy(outputName, fileName, extension - fileName);
+        strcat(outputName, outputSuffix);
+        strcat(outputName, extension);
+    }
+    return outputName;
+}
+
+/*  * * * * * * * * Local helper functions  * * * * * * * * * * * * */
+/* flushOutputs
+ * purpose: background loop that takes every pending content off its slot
+ *          and writes it out without holding the stage lock
+ * return: NULL once the stage is stopping and nothing is pending
+ */
+static void *flushOutputs(void *arg)
+{
+    OutputStage stage = arg;
+    pthread_mutex_lock(&stage->lock);
+    while (true) {
+        while (stage->dirty == 0 && !stage->stopping) {
+            pthread_cond_wait(&stage->work, &stage->lock);
+        }
+        if (stage->dirty == 0) break; /* stopping and fully flushed */
+        for (int i = 0; i < OUTPUT_SLOTS; i++) {
+            OutputSlot *slot = &stage->slots[i];
+            if (slot->pending == NULL) continue;
+            void *content = slot->pending;
+            size_t contentSize = slot->pendingSize;
+            unsigned long generation = slot->lastGeneration;
+            slot->pending = NULL;
+            slot->busy = true;
+            stage->dirty--;
+            pthread_mutex_unlock(&stage->lock);
+            int status = flushSlot(slot, content, contentSize);
+            free(content);
+            pthread_mutex_lock(&stage->lock);
+            slot->busy = false;
+            /* forget a failed generation so the next GET queues it again */
+            if (status < 0 && slot->pending == NULL &&
+                slot->lastGeneration == generation) {
+                slot->lastGeneration = 0;
+            }
+        }
+        pthread_cond_broadcast(&stage->drained);
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return NULL;
+}
+
+/* flushSlot
+ * purpose: write content to the output file of a slot, opening and keeping
+ *          its descriptor on first use
+ * prereq: slot is marked busy so it cannot be reclaimed meanwhile
+ * return: 0 on success, -1 if the output file cannot be opened or written
+ */
+static int flushSlot(OutputSlot *slot, void *content, size_t contentSize)
+{
+    if (slot->fd < 0) {
+        slot->fd = open(slot->outputName, O_WRONLY | O_CREAT, 0666);
+        if (slot->fd < 0) {
+            fprintf(stderr, "cannot open output %s \n", slot->outputName);
+            return -1;
+        }
+    }
+    size_t written = 0;
+    while (written < contentSize) {
+        ssize_t bytes = pwrite(slot->fd, (char *)content + written,
+                               contentSize - written, written);
+        if (bytes <= 0) {
+            fprintf(stderr, "cannot write output %s \n", slot->outputName);
+            return -1;
+        }
+        written += bytes;
+    }
+    return 0;
+}
+
+/* lockSlot
+ * purpose: take the stage lock and find or claim the slot of fileName,
+ *          waiting for the flusher when every slot is still pending
+ * return: pointer to the slot, with the stage lock held
+ */
+static OutputSlot *lockSlot(OutputStage stage, char *fileName)
+{
+    pthread_mutex_lock(&stage->lock);
+    OutputSlot *slot;
+    while ((slot = findSlot(stage, fileName)) == NULL &&
+           (slot = claimSlot(stage, fileName)) == NULL) {
+        pthread_cond_wait(&stage->drained, &stage->lock);
+    }
+    slot->lastUse = ++stage->tick;
+    return slot;
+}
+
+/* queueLocked
+ * purpose: make buffer the pending content of slot and wake the flusher
+ * prereq: stage lock is held; buffer is owned by the stage from now on
+ */
+static void queueLocked(OutputStage stage, OutputSlot *slot, void *buffer,
+                        size_t contentSize, unsigned long generation)
+{
+    if (slot->pending != NULL) {
+        free(slot->pending); /* superseded before it was flushed */
+    } else {
+        stage->dirty++;
+    }
+    slot->pending = buffer;
+    slot->pendingSize = contentSize;
+    slot->lastGeneration = generation;
+    pthread_cond_signal(&stage->work);
+}
+
+/* findSlot
+ * purpose: iterate through the slots to identify the one of fileName
+ * prereq: stage lock is held
+ * return: pointer to the slot; NULL if not found
+ */
+static OutputSlot *findSlot(OutputStage stage, char *fileName)
+{
+    for (int i = 0; i < OUTPUT_SLOTS; i++) {
+        OutputSlot *slot = &stage->slots[i];
+        if (slot->fileName != NULL && strcmp(slot->fileName, fileName) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* claimSlot
+ * purpose: hand an empty slot, or the least recently used one with nothing
+ *          left to flush, over to fileName and close its old descriptor
+ * prereq: stage lock is held
+ * return: pointer to the claimed slot; NULL if every slot is still pending
+ */
+static OutputSlot *claimSlot(OutputStage stage, char *fileName)
+{
+    OutputSlot *victim = NULL;
+    for (int i = 0; i < OUTPUT_SLOTS; i++) {
+        OutputSlot *slot = &stage->slots[i];
+        if (slot->fileName == NULL) {
+            victim = slot;
+            break;
+        }
+        if (slot->busy || slot->pending != NULL) continue;
+        if (victim == NULL || slot->lastUse < victim->lastUse) victim = slot;
+    }
+    if (victim == NULL) return NULL;
+    if (victim->fd >= 0) close(victim->fd);
+    free(victim->fileName);
+    free(victim->outputName);
+    victim->fileName = strcpy(calloc(strlen(fileName) + 1, sizeof(char)), fileName);
+    victim->outputName = makeOutputName(fileName);
+    victim->fd = -1;
+    victim->lastGeneration = 0;
+    return victim;
+}
@@ -0,0 +1,57 @@
+#ifndef OUTPUT_STAGE_INCLUDED
+#define OUTPUT_STAGE_INCLUDED
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define OUTPUT_SLOTS 64
+
+typedef struct outputSlot OutputSlot;
+typedef struct outputStage* OutputStage;
+
+/* one cached output file: its precomputed path, its (lazily opened)
+ * descriptor and the newest content generation handed to the stage;
+ * lastGeneration is reset to 0 when writing that generation fails */
+struct outputSlot {
+    char *fileName;
+    char *outputName;
+    int fd;
+    unsigned long lastGeneration;
+    unsigned long lastUse;
+    void *pending;
+    size_t pendingSize;
+    bool busy;
+};
+
+struct outputStage {
+    OutputSlot slots[OUTPUT_SLOTS];
+    unsigned long tick;
+    size_t dirty;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t drained;
+    pthread_t flusher;
+};
+
+
+OutputStage initOutputStage(void);
+void closeOutputStage(OutputStage stage);
+int submitOutput(OutputStage stage, char *fileName, void *content,
+                 size_t contentSize, unsigned long generation);
+int submitOwnedOutput(OutputStage stage, char *fileName, void *buffer,
+                      size_t contentSize, unsigned long generation);
+bool isQueued(OutputStage stage, char *fileName, unsigned long generation);
+char *makeOutputName(char *fileName);
+
+
+#endif
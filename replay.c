@@ -0,0 +1,564 @@
+#include "replay.h"
+
+/* top bits of the key hash that decide if a key is sampled */
+#define SAMPLE_BITS 24
+/* smallest number of reference times a stack model covers */
+#define MIN_WINDOW 1024
+
+static size_t commandBytes(char *trace, size_t traceSize);
+static void *scanChunk(void *arg);
+static void *runWorker(void *arg);
+static void *measureStack(void *arg);
+static void initQueue(CommandQueue *queue);
+static void freeQueue(CommandQueue *queue);
+static void pushCommands(CommandQueue *queue, ReplayCommand *commands, size_t count);
+static void closeQueue(CommandQueue *queue);
+static size_t popCommands(CommandQueue *queue, ReplayCommand *commands, size_t max);
+static uint64_t hashKey(char *key, size_t keyLen);
+static void initStack(StackModel *model);
+static void freeStack(StackModel *model);
+static KeyRecency *findKey(StackModel *model, char *key, uint32_t keyLen, uint64_t keyHash);
+static void growTable(StackModel *model);
+static void rebaseStack(StackModel *model);
+static int compareLast(const void *a, const void *b);
+static void recordDistance(Replay R, StackModel *model, ReplayCommand *command);
+static void countDistance(Replay R, size_t distance);
+static void addMark(StackModel *model, size_t time, long value);
+static long countMarks(StackModel *model, size_t time);
+static double hitRatio(Replay R, size_t size);
+static void printCurve(Replay R, size_t capacity);
+
+
+/* replayParallel
+ * purpose: replay a command file on several threads; the file is split
+ *          into up to REPLAY_CHUNKS newline aligned chunks that are
+ *          scanned in parallel, and every command is streamed through a
+ *          bounded queue to the worker its key hashes to; a worker drains
+ *          the queues of the chunks in file order, so the commands of one
+ *          key keep their order, against a cache with its share of
+ *          capacity
+ *          the commands of a sample of the keys are also streamed, in
+ *          file order, to one more thread that measures their LRU stack
+ *          distances, printed as hit ratio per cache size once the replay
+ *          is done; the estimate is the same for any number of workers
+ * prereq: 0 < workers <= REPLAY_MAX_WORKERS and 0 < sampleRate <= 1
+ * return: 0 on success, -1 if the command file cannot be mapped
+ * parameter:
+ *      traceName: path of the command file
+ *      capacity: total size of the Cache, split among the workers
+ *      workers: number of replay threads
+ *      sampleRate: fraction of keys whose stack distance is measured
+ *      appendOnly: files are only appended to, see refreshNode
+ *      stage: write-behind stage receiving the output of GET commands
+ * notes: memory use is bounded by the queues (REPLAY_CHUNKS * workers *
+ *        REPLAY_QUEUE commands) plus the sampled keys, not by the trace
+ *        as in the sequential replay, the commands end at the first empty
+ *        line and a line that is neither PUT nor GET fails the assertion
+ *        in splitCommand
+ */
+int replayParallel(char *traceName, size_t capacity, int workers,
+                   double sampleRate, bool appendOnly, OutputStage stage)
+{
+    assert(workers > 0 && workers <= REPLAY_MAX_WORKERS);
+    assert(sampleRate > 0 && sampleRate <= 1);
+    int fd = open(traceName, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *trace = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    /* every worker cache needs room for at least one file */
+    if (capacity > 0 && (size_t)workers > capacity) workers = capacity;
+
+    int chunkCount = (workers < REPLAY_CHUNKS) ? workers : REPLAY_CHUNKS;
+    size_t queueCount = (size_t)chunkCount * workers;
+    struct replay R = {trace, commandBytes(trace, info.st_size), workers, chunkCount, sampleRate,
+                       appendOnly, stage, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0};
+    R.chunks = calloc(chunkCount, sizeof(ReplayChunk));
+    R.pool = calloc(workers, sizeof(ReplayWorker));
+    R.queues = calloc(queueCount, sizeof(CommandQueue));
+    R.samples = calloc(chunkCount, sizeof(CommandQueue));
+    int threadCount = chunkCount + workers + 1;
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    assert(R.chunks != NULL && R.pool != NULL && R.queues != NULL &&
+           R.samples != NULL && threads != NULL);
+    for (size_t q = 0; q < queueCount; q++) initQueue(&R.queues[q]);
+    for (int c = 0; c < chunkCount; c++) initQueue(&R.samples[c]);
+
+    /* scanners and workers run at the same time, linked by the queues */
+    size_t start = 0;
+    for (int c = 0; c < chunkCount; c++) {
+        size_t end = (c == chunkCount - 1) ? R.traceSize
+                                           : R.traceSize / chunkCount * (c + 1);
+        if (end < start) end = start;
+        while (end > 0 && end < R.traceSize && trace[end - 1] != '\n') end++;
+        R.chunks[c].owner = &R;
+        R.chunks[c].index = c;
+        R.chunks[c].start = start;
+        R.chunks[c].end = end;
+        int status = pthread_create(&threads[c], NULL, scanChunk, &R.chunks[c]);
+        assert(status == 0);
+        start = end;
+    }
+    for (int w = 0; w < workers; w++) {
+        R.pool[w].owner = &R;
+        R.pool[w].index = w;
+        R.pool[w].cap = capacity / workers + ((size_t)w < capacity % workers);
+        int status = pthread_create(&threads[chunkCount + w], NULL, runWorker, &R.pool[w]);
+        assert(status == 0);
+    }
+    int status = pthread_create(&threads[threadCount - 1], NULL, measureStack, &R);
+    assert(status == 0);
+    for (int t = 0; t < threadCount; t++) pthread_join(threads[t], NULL);
+
+    printCurve(&R, capacity);
+
+    free(R.distances);
+    for (size_t q = 0; q < queueCount; q++) freeQueue(&R.queues[q]);
+    for (int c = 0; c < chunkCount; c++) freeQueue(&R.samples[c]);
+    free(R.samples);
+    free(R.queues);
+    free(R.chunks);
+    free(R.pool);
+    free(threads);
+    munmap(trace, info.st_size);
+    return 0;
+}
+
+/*  * * * * * * * * Local helper functions  * * * * * * * * * * * * */
+/* commandBytes
+ * purpose: find where the commands of a trace end; like readaLine in the
+ *          sequential replay, the first empty line ends them
+ * return: number of bytes up to and including the last command line
+ */
+static size_t commandBytes(char *trace, size_t traceSize)
+{
+    size_t line = 0;
+    while (line < traceSize && trace[line] != '\n') {
+        char *newline = memchr(trace + line, '\n', traceSize - line);
+        if (newline == NULL) return traceSize;
+        line = newline - trace + 1;
+    }
+    return line;
+}
+
+/* scanChunk
+ * purpose: locate every command of a chunk and stream it, in
+ *          batches, to the queue of the worker its key hashes to, and to
+ *          the sample queue of the chunk if its key is sampled
+ */
+static void *scanChunk(void *arg)
+{
+    ReplayChunk *chunk = arg;
+    Replay R = chunk->owner;
+    CommandQueue *queues = &R->queues[(size_t)chunk->index * R->workers];
+    /* staging area w holds commands for worker w, the last one samples */
+    ReplayCommand *staged = malloc((size_t)(R->workers + 1) * REPLAY_BATCH *
+                                   sizeof(ReplayCommand));
+    size_t *stagedSize = calloc(R->workers + 1, sizeof(size_t));
+    size_t maxLen = 50;
+    char *scratch = malloc(maxLen * sizeof(char));
+    assert(staged != NULL && stagedSize != NULL && scratch != NULL);
+    size_t line = chunk->start;
+    while (line < chunk->end) {
+        char *newline = memchr(R->trace + line, '\n', chunk->end - line);
+        size_t lineLen = (newline != NULL) ? (size_t)(newline - (R->trace + line))
+                                           : chunk->end - line;
+        if (lineLen > 0) { /* splitCommand asserts on other commands */
+            if (lineLen + 1 > maxLen) {
+                maxLen = lineLen + 1;
+                scratch = realloc(scratch, maxLen);
+                assert(scratch != NULL);
+            }
+            memcpy(scratch, R->trace + line, lineLen);
+            scratch[lineLen] = '\0';
+            char *key;
+            int maxAge;
+            ReplayCommand command;
+            command.isGet = splitCommand(scratch, &key, &maxAge) == 'G';
+            command.line = line;
+            command.lineLen = lineLen;
+            command.keyOffset = key - scratch;
+            command.keyLen = strlen(key);
+            command.keyHash = hashKey(key, command.keyLen);
+            int w = command.keyHash % R->workers;
+            staged[w * REPLAY_BATCH + stagedSize[w]++] = command;
+            if (stagedSize[w] == REPLAY_BATCH) {
+                pushCommands(&queues[w], &staged[w * REPLAY_BATCH], REPLAY_BATCH);
+                stagedSize[w] = 0;
+            }
+            int s = R->workers;
+            if ((command.keyHash >> (64 - SAMPLE_BITS)) <
+                R->sampleRate * (1 << SAMPLE_BITS)) {
+                staged[s * REPLAY_BATCH + stagedSize[s]++] = command;
+                if (stagedSize[s] == REPLAY_BATCH) {
+                    pushCommands(&R->samples[chunk->index],
+                                 &staged[s * REPLAY_BATCH], REPLAY_BATCH);
+                    stagedSize[s] = 0;
+                }
+            }
+        }
+        line += lineLen + 1;
+    }
+    for (int w = 0; w < R->workers; w++) {
+        pushCommands(&queues[w], &staged[w * REPLAY_BATCH], stagedSize[w]);
+        closeQueue(&queues[w]);
+    }
+    pushCommands(&R->samples[chunk->index], &staged[R->workers * REPLAY_BATCH],
+                 stagedSize[R->workers]);
+    closeQueue(&R->samples[chunk->index]);
+    free(scratch);
+    free(stagedSize);
+    free(staged);
+    return NULL;
+}
+
+/* runWorker
+ * purpose: replay the commands of one key partition chunk by chunk, so in
+ *          trace order, against the worker's own cache
+ */
+static void *runWorker(void *arg)
+{
+    ReplayWorker *worker = arg;
+    Replay R = worker->owner;
+    Cache shard = initializeCache(worker->cap);
+    shard.appendOnly = R->appendOnly;
+    struct timespec trackTime = {0, 0};
+
+    ReplayCommand batch[REPLAY_BATCH];
+    size_t maxLen = 50;
+    char *command = malloc(maxLen * sizeof(char));
+    assert(command != NULL);
+    for (int c = 0; c < R->chunkCount; c++) {
+        CommandQueue *queue = &R->queues[(size_t)c * R->workers + worker->index];
+        size_t count;
+        while ((count = popCommands(queue, batch, REPLAY_BATCH)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                ReplayCommand *curr = &batch[i];
+                if (curr->lineLen + 1 > maxLen) {
+                    maxLen = curr->lineLen + 1;
+                    command = realloc(command, maxLen);
+                    assert(command != NULL);
+                }
+                memcpy(command, R->trace + curr->line, curr->lineLen);
+                command[curr->lineLen] = '\0';
+                parseCommand(&shard, command, &trackTime, R->stage);
+            }
+        }
+    }
+    free(command);
+    cleanCache(shard);
+    return NULL;
+}
+
+/* measureStack
+ * purpose: record the LRU stack distance of every sampled command, taking
+ *          the sample queues chunk by chunk, so in trace order
+ */
+static void *measureStack(void *arg)
+{
+    Replay R = arg;
+    StackModel model;
+    initStack(&model);
+    ReplayCommand batch[REPLAY_BATCH];
+    for (int c = 0; c < R->chunkCount; c++) {
+        size_t count;
+        while ((count = popCommands(&R->samples[c], batch, REPLAY_BATCH)) > 0) {
+            for (size_t i = 0; i < count; i++) recordDistance(R, &model, &batch[i]);
+        }
+    }
+    freeStack(&model);
+    return NULL;
+}
+
+static void initQueue(CommandQueue *queue)
+{
+    queue->head = 0;
+    queue->size = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+}
+
+static void freeQueue(CommandQueue *queue)
+{
+    pthread_cond_destroy(&queue->notFull);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+/* pushCommands
+ * purpose: append count commands to a queue, waiting while it is full
+ */
+static void pushCommands(CommandQueue *queue, ReplayCommand *commands, size_t count)
+{
+    pthread_mutex_lock(&queue->lock);
+    for (size_t i = 0; i < count; i++) {
+        while (queue->size == REPLAY_QUEUE) {
+            pthread_cond_signal(&queue->notEmpty);
+            pthread_cond_wait(&queue->notFull, &queue->lock);
+        }
+        queue->commands[(queue->head + queue->size++) % REPLAY_QUEUE] = commands[i];
+    }
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void closeQueue(CommandQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* popCommands
+ * purpose: take up to max commands off a queue, waiting while it is empty
+ * return: number of commands taken; 0 once the queue is closed and empty
+ */
+static size_t popCommands(CommandQueue *queue, ReplayCommand *commands, size_t max)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->size == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+    }
+    size_t count = 0;
+    while (count < max && queue->size > 0) {
+        commands[count++] = queue->commands[queue->head];
+        queue->head = (queue->head + 1) % REPLAY_QUEUE;
+        queue->size--;
+    }
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/* hashKey
+ * purpose: 64 bit FNV-1a hash of a file name
+ */
+static uint64_t hashKey(char *key, size_t keyLen)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < keyLen; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void initStack(StackModel *model)
+{
+    model->tableSize = 64;
+    model->table = calloc(model->tableSize, sizeof(KeyRecency));
+    model->keys = 0;
+    model->window = MIN_WINDOW;
+    model->marks = calloc(model->window + 1, sizeof(long));
+    model->now = 0;
+    assert(model->table != NULL && model->marks != NULL);
+}
+
+static void freeStack(StackModel *model)
+{
+    for (size_t i = 0; i < model->tableSize; i++) free(model->table[i].key);
+    free(model->table);
+    free(model->marks);
+}
+
+/* findKey
+ * purpose: find the entry of a key, or the empty entry where it belongs
+ */
+static KeyRecency *findKey(StackModel *model, char *key, uint32_t keyLen, uint64_t keyHash)
+{
+    size_t mask = model->tableSize - 1;
+    /* the low and high bits of keyHash pick the worker and the sample */
+    size_t slot = (keyHash * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+    while (model->table[slot].key != NULL) {
+        KeyRecency *seen = &model->table[slot];
+        if (seen->keyHash == keyHash && seen->keyLen == keyLen &&
+            memcmp(seen->key, key, keyLen) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+    return &model->table[slot];
+}
+
+/* growTable
+ * purpose: double the key table and reinsert every key
+ */
+static void growTable(StackModel *model)
+{
+    KeyRecency *old = model->table;
+    size_t oldSize = model->tableSize;
+    model->tableSize *= 2;
+    model->table = calloc(model->tableSize, sizeof(KeyRecency));
+    assert(model->table != NULL);
+    for (size_t i = 0; i < oldSize; i++) {
+        if (old[i].key == NULL) continue;
+        *findKey(model, old[i].key, old[i].keyLen, old[i].keyHash) = old[i];
+    }
+    free(old);
+}
+
+/* rebaseStack
+ * purpose: renumber the latest reference times of all keys as 1..keys,
+ *          keeping their order, and rebuild the tree with room for as
+ *          many new references again
+ */
+static void rebaseStack(StackModel *model)
+{
+    KeyRecency **order = malloc((model->keys + 1) * sizeof(KeyRecency *));
+    assert(order != NULL);
+    size_t count = 0;
+    for (size_t i = 0; i < model->tableSize; i++) {
+        if (model->table[i].key != NULL) order[count++] = &model->table[i];
+    }
+    qsort(order, count, sizeof(KeyRecency *), compareLast);
+    model->window = (2 * count > MIN_WINDOW) ? 2 * count : MIN_WINDOW;
+    free(model->marks);
+    model->marks = calloc(model->window + 1, sizeof(long));
+    assert(model->marks != NULL);
+    model->now = 0;
+    for (size_t i = 0; i < count; i++) {
+        order[i]->last = ++model->now;
+        addMark(model, model->now, 1);
+    }
+    free(order);
+}
+
+static int compareLast(const void *a, const void *b)
+{
+    size_t left = (*(KeyRecency **)a)->last;
+    size_t right = (*(KeyRecency **)b)->last;
+    return (left > right) - (left < right);
+}
+
+/* recordDistance
+ * purpose: move a sampled key to the top of the LRU stack; for a GET,
+ *          count the distinct keys referenced since its previous reference
+ *          or a cold miss if there is none
+ */
+static void recordDistance(Replay R, StackModel *model, ReplayCommand *command)
+{
+    char *key = R->trace + command->line + command->keyOffset;
+    if (2 * (model->keys + 1) > model->tableSize) growTable(model);
+    if (model->now == model->window) rebaseStack(model);
+    KeyRecency *recency = findKey(model, key, command->keyLen, command->keyHash);
+    size_t now = ++model->now;
+    if (command->isGet) R->gets++;
+    if (recency->key == NULL) { /* first reference of the key */
+        recency->key = malloc(command->keyLen);
+        assert(recency->key != NULL);
+        memcpy(recency->key, key, command->keyLen);
+        recency->keyLen = command->keyLen;
+        recency->keyHash = command->keyHash;
+        model->keys++;
+        if (command->isGet) R->coldMisses++;
+    } else {
+        size_t distance = countMarks(model, now - 1) - countMarks(model, recency->last);
+        addMark(model, recency->last, -1);
+        if (command->isGet) countDistance(R, distance);
+    }
+    addMark(model, now, 1);
+    recency->last = now;
+}
+
+/* countDistance
+ * purpose: add one GET to the distance histogram, growing it as needed
+ */
+static void countDistance(Replay R, size_t distance)
+{
+    if (distance >= R->distanceSize) {
+        size_t size = (R->distanceSize == 0) ? 64 : R->distanceSize;
+        while (size <= distance) size *= 2;
+        R->distances = realloc(R->distances, size * sizeof(size_t));
+        assert(R->distances != NULL);
+        memset(R->distances + R->distanceSize, 0,
+               (size - R->distanceSize) * sizeof(size_t));
+        R->distanceSize = size;
+    }
+    R->distances[distance]++;
+    if (distance > R->maxDistance) R->maxDistance = distance;
+}
+
+static void addMark(StackModel *model, size_t time, long value)
+{
+    for (; time <= model->window; time += time & -time) {
+        model->marks[time] += value;
+    }
+}
+
+static long countMarks(StackModel *model, size_t time)
+{
+    long count = 0;
+    for (; time > 0; time -= time & -time) count += model->marks[time];
+    return count;
+}
+
+/* hitRatio
+ * purpose: estimate the GET hit ratio of an LRU cache holding size files;
+ *          only sampleRate of the keys are measured, so stack distances
+ *          are scaled up by the inverse
+ */
+static double hitRatio(Replay R, size_t size)
+{
+    double scale = 1 / R->sampleRate;
+    size_t hits = 0;
+    /* d distinct keys in between: the key is at depth d + 1 of the stack */
+    for (size_t d = 0; d < R->distanceSize && (d + 1) * scale <= size; d++) {
+        hits += R->distances[d];
+    }
+    return (double)hits / R->gets;
+}
+
+/* printCurve
+ * purpose: print the estimated hit ratio for cache sizes doubling from the
+ *          resolution of the estimate until every reuse fits, and for the
+ *          requested capacity
+ * notes: a sampled distance stands for 1 / sampleRate files, so a smaller
+ *        cache size cannot be estimated and is reported as such
+ */
+static void printCurve(Replay R, size_t capacity)
+{
+    double scale = 1 / R->sampleRate;
+    size_t largest = (R->maxDistance + 1) * scale;
+    if (R->gets == 0) {
+        printf("no GET of a sampled file; raise -r to estimate hit ratios\n");
+        return;
+    }
+    printf("cache size  hit ratio (LRU estimate, sample rate %g)\n", R->sampleRate);
+    size_t first = 1;
+    while (first < scale) first *= 2;
+    if (capacity > 0 && capacity < scale) {
+        printf("%10zu  below resolution of %g files\n", capacity, scale);
+    }
+    size_t previous = 0;
+    for (size_t size = first; ; size *= 2) {
+        if (capacity >= scale && capacity > previous && capacity < size) {
+            printf("%10zu  %.4f\n", capacity, hitRatio(R, capacity));
+        }
+        printf("%10zu  %.4f\n", size, hitRatio(R, size));
+        if (size >= largest && size >= capacity) break;
+        if (size > SIZE_MAX / 2) { /* doubling again would wrap around */
+            if (capacity > size) {
+                printf("%10zu  %.4f\n", capacity, hitRatio(R, capacity));
+            }
+            break;
+        }
+        previous = size;
+    }
+}
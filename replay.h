@@ -0,0 +1,123 @@
+#ifndef REPLAY_INCLUDED
+#define REPLAY_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cache.h"
+#include "file_handler.h"
+#include "output_stage.h"
+
+/* most trace chunks scanned in parallel, whatever the thread count */
+#define REPLAY_CHUNKS 8
+/* most replay threads accepted by -j */
+#define REPLAY_MAX_WORKERS 256
+/* commands buffered between one chunk scanner and one worker */
+#define REPLAY_QUEUE 256
+/* commands moved through a queue at once */
+#define REPLAY_BATCH 64
+/* default fraction of keys whose stack distance is measured */
+#define REPLAY_SAMPLE_RATE 0.01
+
+typedef struct replayCommand ReplayCommand;
+typedef struct commandQueue CommandQueue;
+typedef struct replayChunk ReplayChunk;
+typedef struct replayWorker ReplayWorker;
+typedef struct keyRecency KeyRecency;
+typedef struct stackModel StackModel;
+typedef struct replay* Replay;
+
+/* one command line of the trace, located by offsets into the mapped trace */
+struct replayCommand {
+    size_t line;
+    uint32_t lineLen;
+    uint32_t keyOffset;
+    uint32_t keyLen;
+    uint64_t keyHash;
+    bool isGet;
+};
+
+/* bounded ring of commands from one chunk scanner to one worker; closed
+ * once the scanner reached the end of its chunk */
+struct commandQueue {
+    ReplayCommand commands[REPLAY_QUEUE];
+    size_t head;
+    size_t size;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+};
+
+/* a newline aligned part of the trace */
+struct replayChunk {
+    Replay owner;
+    int index;
+    size_t start;
+    size_t end;
+};
+
+/* a worker replays every command whose key hashes to it, against its own
+ * cache holding its share of the capacity */
+struct replayWorker {
+    Replay owner;
+    int index;
+    size_t cap;
+};
+
+/* last reference time of a sampled key, found by open addressing */
+struct keyRecency {
+    char *key;
+    uint32_t keyLen;
+    uint64_t keyHash;
+    size_t last;
+};
+
+/* LRU stack of the sampled keys of the whole trace: marks holds a Fenwick tree over
+ * the reference times 1..window with a 1 at the latest reference time of
+ * every key, so the number of distinct keys referenced since a time is a
+ * prefix sum; times are renumbered when the window is used up, so both
+ * the table and the tree grow with the number of keys only */
+struct stackModel {
+    KeyRecency *table;
+    size_t tableSize;
+    size_t keys;
+    long *marks;
+    size_t window;
+    size_t now;
+};
+
+struct replay {
+    char *trace;
+    size_t traceSize;
+    int workers;
+    int chunkCount;
+    double sampleRate;
+    bool appendOnly;
+    OutputStage stage;
+    ReplayChunk *chunks;
+    ReplayWorker *pool;
+    CommandQueue *queues; /* queues[chunk * workers + worker] */
+    CommandQueue *samples; /* samples[chunk]: sampled commands of a chunk */
+    size_t gets; /* sampled GETs */
+    size_t coldMisses;
+    size_t *distances; /* distances[d]: GETs with d distinct keys between */
+    size_t distanceSize;
+    size_t maxDistance;
+};
+
+
+int replayParallel(char *traceName, size_t capacity, int workers,
+                   double sampleRate, bool appendOnly, OutputStage stage);
+
+
+#endif
@@ -0,0 +1,618 @@
+#include "shared_cache.h"
+#include "cache.h"
+
+#define SENTINELS 4
+
+static bool layoutSize(size_t capacity, size_t slotBytes, size_t *segmentSize);
+static size_t attachSize(int fd);
+static bool attachReady(SharedCache SC);
+static void initSegment(SharedCache SC, size_t capacity, size_t slotBytes);
+static void lockShared(SharedCache SC);
+static void rebuildShared(SharedCache SC);
+static size_t hashName(char *keyName);
+static void unlockShared(SharedCache SC);
+static SharedSlot *slotAt(SharedCache SC, Offset at);
+static Offset findShared(SharedCache SC, char *keyName);
+static Offset freeShared(SharedCache SC);
+static void linkAfter(SharedCache SC, Offset head, Offset target);
+static void unlinkSlot(SharedCache SC, Offset target);
+static void moveToPut(SharedCache SC, Offset target);
+static void removeSlot(SharedCache SC, Offset target);
+static void evictShared(SharedCache SC, float currTime);
+static Offset oldestStaleShared(SharedCache SC, Offset head, Offset tail, float currTime);
+static bool isStaleSlot(float currTime, SharedSlot *slot);
+static bool copySlot(SharedCache SC, SharedSlot *slot, char *keyName,
+                     unsigned long generation, OutputStage stage);
+static void beginWrite(SharedSlot *slot);
+static void endWrite(SharedSlot *slot);
+
+
+/* openSharedCache
+ * purpose: create the POSIX shared memory segment called name, or attach
+ *          to it if another process already created it
+ * prereq: name starts with '/', capacity and slotBytes are positive
+ * return: handle to the mapped segment; NULL on failure, including an
+ *         existing segment that is not a complete cache segment after
+ *         SHARED_ATTACH_WAIT milliseconds (e.g. its creator died)
+ * parameter:
+ *      name: name of the shared memory object
+ *      capacity: requested size of the Cache, used only on creation
+ *      slotBytes: largest file content one entry can hold, used only on
+ *                 creation
+ */
+SharedCache openSharedCache(char *name, size_t capacity, size_t slotBytes)
+{
+    assert(name != NULL && capacity > 0 && slotBytes > 0);
+    size_t segmentSize;
+    if (!layoutSize(capacity, slotBytes, &segmentSize)) {
+        fprintf(stderr, "shared cache of %zu files of %zu bytes is too large \n",
+                capacity, slotBytes);
+        return NULL;
+    }
+    bool created = true;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, SHARED_MODE);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(name, O_RDWR, SHARED_MODE);
+    }
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if (created && ftruncate(fd, segmentSize) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    if (!created) segmentSize = attachSize(fd);
+    if (segmentSize == 0) {
+        close(fd);
+        fprintf(stderr, "shared cache %s is not initialized; remove /dev/shm%s \n",
+                name, name);
+        return NULL;
+    }
+    void *base = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    SharedCache SC = malloc(sizeof(struct sharedCache));
+    assert(SC != NULL);
+    SC->header = base;
+    SC->mappedSize = segmentSize;
+    if (created) {
+        initSegment(SC, capacity, slotBytes);
+    } else if (!attachReady(SC)) {
+        fprintf(stderr, "shared cache %s is incomplete or of another layout; \
+remove /dev/shm%s \n", name, name);
+        closeSharedCache(SC);
+        return NULL;
+    } else {
+        if (SC->header->cap != capacity) {
+            fprintf(stderr, "attached to shared cache of size %zu \n", SC->header->cap);
+        }
+    }
+    return SC;
+}
+
+/* closeSharedCache
+ * purpose: unmap the segment from this process; the segment and its
+ *          entries stay available to other processes
+ * prereq: SC was returned by openSharedCache
+ * return: None
+ */
+void closeSharedCache(SharedCache SC)
+{
+    assert(SC != NULL);
+    munmap(SC->header, SC->mappedSize);
+    free(SC);
+}
+
+/* renewShared
+ * purpose: handle a PUT of a file whose entry in the segment still holds
+ *          the current version of the file, without copying its content
+ * prereq: info was filled by stat on the target file
+ * return: True if the entry was renewed, False if it is absent or stale
+ *         so that the file has to be read and stored with putShared
+ * parameter:
+ *      keyName: target filename that we are looking for
+ *      maxAge: integer represents the time to live of a file
+ *      entryTime: CPU seconds elapsed since program started
+ */
+bool renewShared(SharedCache SC, char *keyName, struct stat *info,
+                 int maxAge, float entryTime)
+{
+    lockShared(SC);
+    Offset at = findShared(SC, keyName);
+    if (at == 0 || !sameStamp(&slotAt(SC, at)->stamp, info)) {
+        unlockShared(SC);
+        return false;
+    }
+    SharedSlot *slot = slotAt(SC, at);
+    slot->maxAge = maxAge;
+    slot->entryTime = entryTime;
+    moveToPut(SC, at);
+    unlockShared(SC);
+    return true;
+}
+
+/* putShared
+ * purpose: store the content of a file in the segment, following the same
+ *          eviction policy as evictCache when the segment is full
+ * prereq: info was filled by fstat on the file content was read from
+ * return: 0 on success, -1 if the file name or content does not fit
+ * parameter:
+ *      keyName: target filename, serving as contentKey
+ *      content: the bytes of contents associated with contentKey
+ *      contentSize: total number of bytes of content
+ *      maxAge: integer represents the time to live of a file
+ *      entryTime: CPU seconds elapsed since program started
+ */
+int putShared(SharedCache SC, char *keyName, void *content, size_t contentSize,
+              struct stat *info, int maxAge, float entryTime)
+{
+    SharedHeader *H = SC->header;
+    if (strlen(keyName) >= SHARED_KEYLEN) {
+        fprintf(stderr, "file name too long for shared cache \n");
+        return -1;
+    }
+    lockShared(SC);
+    Offset at = findShared(SC, keyName);
+    if (contentSize > H->slotBytes) { /* never serve the old version */
+        if (at != 0) removeSlot(SC, at);
+        unlockShared(SC);
+        fprintf(stderr, "file too large for shared cache \n");
+        return -1;
+    }
+    if (at == 0) {
+        if (H->putSize + H->getSize >= H->cap) evictShared(SC, entryTime);
+        at = freeShared(SC);
+        assert(at != 0);
+    }
+    /* the whole update is inside the write, see rebuildShared */
+    SharedSlot *slot = slotAt(SC, at);
+    beginWrite(slot);
+    if (slot->used) {
+        moveToPut(SC, at);
+    } else {
+        slot->used = true;
+        slot->retrieved = false;
+        linkAfter(SC, H->putHead, at);
+        H->putSize++;
+    }
+    strcpy(slot->fileName, keyName);
+    if (contentSize > 0) memcpy((char *)H + slot->content, content, contentSize);
+    slot->contentSize = contentSize;
+    slot->maxAge = maxAge;
+    slot->entryTime = entryTime;
+    slot->generation = ++H->lastGeneration;
+    makeStamp(&slot->stamp, info);
+    endWrite(slot);
+    unlockShared(SC);
+    return 0;
+}
+
+/* getShared
+ * purpose: handle a GET operation to the segment; the lists are updated
+ *          under the segment lock, the content is copied to the output
+ *          stage without it, and the copy is redone if the entry was
+ *          rewritten meanwhile
+ * prereq: None
+ * return: 0 if the file was found, -1 if absent
+ * parameter:
+ *      keyName: target filename that we are looking for
+ *      entryTime: CPU seconds elapsed since program started
+ *      stage: write-behind stage that writes the output file
+ */
+int getShared(SharedCache SC, char *keyName, float entryTime, OutputStage stage)
+{
+    SharedHeader *H = SC->header;
+    while (true) {
+        lockShared(SC);
+        Offset at = findShared(SC, keyName);
+        if (at == 0) { /* absent file node retrieval */
+            unlockShared(SC);
+            return -1;
+        }
+        SharedSlot *slot = slotAt(SC, at);
+        unlinkSlot(SC, at);
+        linkAfter(SC, H->getHead, at);
+        if (slot->retrieved == false) { /* moving from putList to getList */
+            slot->retrieved = true;
+            H->getSize++;
+            H->putSize--;
+        }
+        if (isStaleSlot(entryTime, slot)) slot->entryTime = entryTime;
+        unsigned long generation = slot->generation;
+        unlockShared(SC);
+        if (isQueued(stage, keyName, generation)) return 0;
+        if (copySlot(SC, slot, keyName, generation, stage)) return 0;
+    }
+}
+
+/*  * * * * * * * * Local helper functions  * * * * * * * * * * * * */
+/* layoutSize
+ * purpose: compute the bytes of a segment holding capacity slots of
+ *          slotBytes content each
+ * return: False if the size does not fit in a size_t
+ */
+static bool layoutSize(size_t capacity, size_t slotBytes, size_t *segmentSize)
+{
+    size_t slots, arena;
+    if (__builtin_add_overflow(capacity, SENTINELS, &slots) ||
+        __builtin_mul_overflow(slots, sizeof(SharedSlot), &slots) ||
+        __builtin_mul_overflow(capacity, slotBytes, &arena) ||
+        __builtin_add_overflow(slots, arena, segmentSize) ||
+        __builtin_add_overflow(*segmentSize, sizeof(SharedHeader), segmentSize) ||
+        *segmentSize > (size_t)((off_t)-1 >> 1)) {
+        return false;
+    }
+    return true;
+}
+
+/* attachSize
+ * purpose: wait, at most SHARED_ATTACH_WAIT milliseconds, until the
+ *          creator of an existing segment has sized it
+ * return: size of the segment; 0 on failure or timeout
+ */
+static size_t attachSize(int fd)
+{
+    struct stat info;
+    for (int waited = 0; waited <= SHARED_ATTACH_WAIT; waited++) {
+        if (fstat(fd, &info) < 0) {
+            perror("fstat");
+            return 0;
+        }
+        if ((size_t)info.st_size >= sizeof(SharedHeader)) return info.st_size;
+        usleep(1000);
+    }
+    return 0;
+}
+
+/* attachReady
+ * purpose: wait, at most SHARED_ATTACH_WAIT milliseconds, until the
+ *          creator has initialized the segment, then check that its
+ *          layout matches this program and fits in the mapping
+ * return: True if the segment can be used
+ */
+static bool attachReady(SharedCache SC)
+{
+    SharedHeader *H = SC->header;
+    int waited = 0;
+    while (__atomic_load_n(&H->ready, __ATOMIC_ACQUIRE) == 0) {
+        if (waited++ == SHARED_ATTACH_WAIT) return false;
+        usleep(1000);
+    }
+    size_t segmentSize;
+    if (H->magic != SHARED_MAGIC || H->version != SHARED_VERSION ||
+        H->cap == 0 || H->slotBytes == 0 ||
+        !layoutSize(H->cap, H->slotBytes, &segmentSize) ||
+        segmentSize != H->segmentSize || segmentSize > SC->mappedSize) {
+        return false;
+    }
+    return H->slots == sizeof(SharedHeader) &&
+           H->arena == H->slots + (H->cap + SENTINELS) * sizeof(SharedSlot) &&
+           H->putHead == H->slots &&
+           H->putTail == H->slots + sizeof(SharedSlot) &&
+           H->getHead == H->slots + 2 * sizeof(SharedSlot) &&
+           H->getTail == H->slots + 3 * sizeof(SharedSlot);
+}
+
+/* initSegment
+ * purpose: lay out a freshly created, zero filled segment and mark it ready
+ */
+static void initSegment(SharedCache SC, size_t capacity, size_t slotBytes)
+{
+    SharedHeader *H = SC->header;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&H->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    H->magic = SHARED_MAGIC;
+    H->version = SHARED_VERSION;
+    H->segmentSize = SC->mappedSize;
+    H->cap = capacity;
+    H->slotBytes = slotBytes;
+    H->slots = sizeof(SharedHeader);
+    H->arena = H->slots + (capacity + SENTINELS) * sizeof(SharedSlot);
+    H->putHead = H->slots;
+    H->putTail = H->slots + sizeof(SharedSlot);
+    H->getHead = H->slots + 2 * sizeof(SharedSlot);
+    H->getTail = H->slots + 3 * sizeof(SharedSlot);
+    slotAt(SC, H->putHead)->next = H->putTail;
+    slotAt(SC, H->putTail)->prev = H->putHead;
+    slotAt(SC, H->getHead)->next = H->getTail;
+    slotAt(SC, H->getTail)->prev = H->getHead;
+    for (size_t i = 0; i < capacity; i++) {
+        slotAt(SC, H->slots + (i + SENTINELS) * sizeof(SharedSlot))->content =
+            H->arena + i * slotBytes;
+    }
+    __atomic_store_n(&H->ready, 1, __ATOMIC_RELEASE);
+}
+
+/* lockShared
+ * purpose: take the segment lock; if its previous owner died holding it,
+ *          rebuild the lists before using them
+ * notes: any other failure to take the lock ends the process
+ */
+static void lockShared(SharedCache SC)
+{
+    SharedHeader *H = SC->header;
+    int status = pthread_mutex_lock(&H->lock);
+    if (status == 0) return;
+    if (status == EOWNERDEAD) {
+        rebuildShared(SC);
+        status = pthread_mutex_consistent(&H->lock);
+    }
+    if (status != 0) {
+        fprintf(stderr, "shared cache lock: %s \n", strerror(status));
+        exit(1);
+    }
+}
+
+/* rebuildShared
+ * purpose: recover from a lock holder that died in the middle of an
+ *          update: drop every slot that was being rewritten or is
+ *          inconsistent, then relink putList and getList and recount
+ *          their sizes from the slot table alone
+ * prereq: segment lock is held
+ * notes: the LRU order inside each list is lost; duplicate names are
+ *        found in the same pass through a temporary table of the names
+ *        kept so far, so recovery stays linear in the capacity
+ */
+static void rebuildShared(SharedCache SC)
+{
+    SharedHeader *H = SC->header;
+    slotAt(SC, H->putHead)->next = H->putTail;
+    slotAt(SC, H->putTail)->prev = H->putHead;
+    slotAt(SC, H->getHead)->next = H->getTail;
+    slotAt(SC, H->getTail)->prev = H->getHead;
+    H->putSize = 0;
+    H->getSize = 0;
+    size_t tableSize = 2;
+    while (tableSize < 2 * H->cap) tableSize *= 2;
+    Offset *kept = calloc(tableSize, sizeof(Offset));
+    assert(kept != NULL);
+    for (size_t i = 0; i < H->cap; i++) {
+        Offset at = H->slots + (i + SENTINELS) * sizeof(SharedSlot);
+        SharedSlot *slot = slotAt(SC, at);
+        slot->fileName[SHARED_KEYLEN - 1] = '\0';
+        bool broken = slot->sequence % 2 == 1 || slot->fileName[0] == '\0' ||
+                      slot->contentSize > H->slotBytes ||
+                      slot->content != H->arena + i * H->slotBytes;
+        if (slot->sequence % 2 == 1) slot->sequence++;
+        if (slot->used && !broken) {
+            size_t probe = hashName(slot->fileName) & (tableSize - 1);
+            while (kept[probe] != 0 &&
+                   strcmp(slotAt(SC, kept[probe])->fileName, slot->fileName) != 0) {
+                probe = (probe + 1) & (tableSize - 1);
+            }
+            broken = kept[probe] != 0; /* duplicate */
+            if (!broken) kept[probe] = at;
+        }
+        if (!slot->used || broken) {
+            slot->used = false;
+            slot->fileName[0] = '\0';
+            slot->content = H->arena + i * H->slotBytes;
+            continue;
+        }
+        if (slot->retrieved) {
+            linkAfter(SC, H->getHead, at);
+            H->getSize++;
+        } else {
+            linkAfter(SC, H->putHead, at);
+            H->putSize++;
+        }
+    }
+    free(kept);
+}
+
+/* hashName
+ * purpose: FNV-1a hash of a file name
+ */
+static size_t hashName(char *keyName)
+{
+    size_t hash = 2166136261u;
+    for (; *keyName != '\0'; keyName++) {
+        hash ^= (unsigned char)*keyName;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void unlockShared(SharedCache SC)
+{
+    pthread_mutex_unlock(&SC->header->lock);
+}
+
+static SharedSlot *slotAt(SharedCache SC, Offset at)
+{
+    return (SharedSlot *)((char *)SC->header + at);
+}
+
+/* findShared
+ * purpose: iterate through the slots to identify the entry of keyName
+ * prereq: segment lock is held
+ * return: offset of the slot; 0 if not found
+ */
+static Offset findShared(SharedCache SC, char *keyName)
+{
+    SharedHeader *H = SC->header;
+    for (size_t i = 0; i < H->cap; i++) {
+        Offset at = H->slots + (i + SENTINELS) * sizeof(SharedSlot);
+        SharedSlot *slot = slotAt(SC, at);
+        if (slot->used && strcmp(slot->fileName, keyName) == 0) return at;
+    }
+    return 0;
+}
+
+/* freeShared
+ * purpose: find an unused slot
+ * prereq: segment lock is held
+ * return: offset of the slot; 0 if the segment is full
+ */
+static Offset freeShared(SharedCache SC)
+{
+    SharedHeader *H = SC->header;
+    for (size_t i = 0; i < H->cap; i++) {
+        Offset at = H->slots + (i + SENTINELS) * sizeof(SharedSlot);
+        if (!slotAt(SC, at)->used) return at;
+    }
+    return 0;
+}
+
+/* linkAfter
+ * purpose: insert the target slot right after the head slot
+ */
+static void linkAfter(SharedCache SC, Offset head, Offset target)
+{
+    SharedSlot *first = slotAt(SC, head);
+    SharedSlot *curr = slotAt(SC, target);
+    curr->prev = head;
+    curr->next = first->next;
+    slotAt(SC, first->next)->prev = target;
+    first->next = target;
+}
+
+/* unlinkSlot
+ * purpose: take the target slot out of the list it is in
+ */
+static void unlinkSlot(SharedCache SC, Offset target)
+{
+    SharedSlot *curr = slotAt(SC, target);
+    slotAt(SC, curr->prev)->next = curr->next;
+    slotAt(SC, curr->next)->prev = curr->prev;
+}
+
+/* moveToPut
+ * purpose: place the target slot at the head of putList as a slot that
+ *          was not retrieved since it was PUT
+ */
+static void moveToPut(SharedCache SC, Offset target)
+{
+    SharedHeader *H = SC->header;
+    SharedSlot *slot = slotAt(SC, target);
+    unlinkSlot(SC, target);
+    linkAfter(SC, H->putHead, target);
+    if (slot->retrieved) {
+        slot->retrieved = false;
+        H->getSize--;
+        H->putSize++;
+    }
+}
+
+/* removeSlot
+ * purpose: drop the target entry from its list and mark the slot unused
+ */
+static void removeSlot(SharedCache SC, Offset target)
+{
+    SharedHeader *H = SC->header;
+    SharedSlot *slot = slotAt(SC, target);
+    beginWrite(slot);
+    unlinkSlot(SC, target);
+    slot->used = false;
+    slot->fileName[0] = '\0';
+    endWrite(slot);
+    if (slot->retrieved) {
+        H->getSize--;
+    } else {
+        H->putSize--;
+    }
+}
+
+/* evictShared
+ * purpose: free one slot following the policy of evictCache
+ *          first priority -> remove oldest stale entry
+ *          second priority -> remove oldest nonretrieved entry (putList)
+ *          third priority -> remove oldest retrieved entry (getList)
+ * prereq: segment lock is held and the segment is not empty
+ */
+static void evictShared(SharedCache SC, float currTime)
+{
+    SharedHeader *H = SC->header;
+    Offset victim = oldestStaleShared(SC, H->putHead, H->putTail, currTime);
+    if (victim == 0) victim = oldestStaleShared(SC, H->getHead, H->getTail, currTime);
+    if (victim == 0) {
+        victim = (H->putSize != 0) ? slotAt(SC, H->putTail)->prev
+                                   : slotAt(SC, H->getTail)->prev;
+    }
+    deleteTargetFile(slotAt(SC, victim)->fileName);
+    removeSlot(SC, victim);
+}
+
+/* oldestStaleShared
+ * purpose: iterate through one list to identify its oldest stale entry
+ * return: offset of the oldest stale slot; 0 if none were stale
+ */
+static Offset oldestStaleShared(SharedCache SC, Offset head, Offset tail, float currTime)
+{
+    float maxTimeDiff = 0.0;
+    Offset oldest = 0;
+    Offset curr = slotAt(SC, head)->next;
+    while (curr != tail) {
+        SharedSlot *slot = slotAt(SC, curr);
+        if (isStaleSlot(currTime, slot)) {
+            float timeElapsed = (currTime - slot->entryTime) / pow(10,9);
+            if (timeElapsed > maxTimeDiff) {
+                oldest = curr;
+                maxTimeDiff = timeElapsed;
+            }
+        }
+        curr = slot->next;
+    }
+    return oldest;
+}
+
+/* isStaleSlot
+ * purpose: same check as isStale for an entry of the segment
+ */
+static bool isStaleSlot(float currTime, SharedSlot *slot)
+{
+    float timeElapsed = (currTime - slot->entryTime) / pow(10,9);
+    if (timeElapsed > slot->maxAge) return true;
+    return slot->maxAge == 0 ? true : false;
+}
+
+/* copySlot
+ * purpose: copy the content of a slot for the output stage without the
+ *          segment lock, reading it like a seqlock
+ * return: True once the copy was handed to the stage, False if the slot
+ *         was rewritten during the copy or no longer holds generation
+ */
+static bool copySlot(SharedCache SC, SharedSlot *slot, char *keyName,
+                     unsigned long generation, OutputStage stage)
+{
+    unsigned int sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence % 2 == 1 || slot->generation != generation) return false;
+    size_t contentSize = slot->contentSize;
+    if (contentSize > SC->header->slotBytes) return false;
+    void *buffer = malloc(contentSize > 0 ? contentSize : 1);
+    assert(buffer != NULL);
+    memcpy(buffer, (char *)SC->header + slot->content, contentSize);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence) {
+        free(buffer);
+        return false;
+    }
+    submitOwnedOutput(stage, keyName, buffer, contentSize, generation);
+    return true;
+}
+
+/* beginWrite / endWrite
+ * purpose: make the slot sequence odd while its fields are rewritten so
+ *          that readers without the segment lock retry their copy
+ */
+static void beginWrite(SharedSlot *slot)
+{
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void endWrite(SharedSlot *slot)
+{
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+}
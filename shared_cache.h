@@ -0,0 +1,88 @@
+#ifndef SHARED_CACHE_INCLUDED
+#define SHARED_CACHE_INCLUDED
+
+#include <stddef.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "file_node.h"
+#include "output_stage.h"
+
+#define SHARED_KEYLEN 256
+#define SHARED_SLOT_BYTES (1 << 20)
+/* the segment holds the cached file contents: owner only */
+#define SHARED_MODE 0600
+#define SHARED_MAGIC 0x4C525543u /* "LRUC" */
+#define SHARED_VERSION 1
+/* milliseconds an attaching process waits for the creator */
+#define SHARED_ATTACH_WAIT 2000
+
+typedef size_t Offset;
+typedef struct sharedSlot SharedSlot;
+typedef struct sharedHeader SharedHeader;
+typedef struct sharedCache* SharedCache;
+
+/* counterpart of a file node inside the segment; prev and next are byte
+ * offsets from the start of the segment, so every process can follow
+ * them wherever the segment is mapped */
+struct sharedSlot {
+    char fileName[SHARED_KEYLEN];
+    bool used;
+    bool retrieved;
+    float entryTime;
+    int maxAge;
+    size_t contentSize;
+    Offset content;
+    unsigned long generation;
+    FileStamp stamp;
+    unsigned int sequence; /* odd while the slot is being rewritten */
+    Offset prev;
+    Offset next;
+};
+
+/* start of the segment: cache bookkeeping, then cap + 4 slots (the first
+ * four are the heads and tails of putList and getList), then the content
+ * arena with slotBytes bytes for each slot */
+struct sharedHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int ready;
+    size_t segmentSize;
+    size_t cap;
+    size_t slotBytes;
+    size_t putSize;
+    size_t getSize;
+    unsigned long lastGeneration;
+    pthread_mutex_t lock;
+    Offset putHead, putTail;
+    Offset getHead, getTail;
+    Offset slots;
+    Offset arena;
+};
+
+struct sharedCache {
+    SharedHeader *header;
+    size_t mappedSize;
+};
+
+
+SharedCache openSharedCache(char *name, size_t capacity, size_t slotBytes);
+void closeSharedCache(SharedCache SC);
+
+bool renewShared(SharedCache SC, char *keyName, struct stat *info,
+                 int maxAge, float entryTime);
+int putShared(SharedCache SC, char *keyName, void *content, size_t contentSize,
+              struct stat *info, int maxAge, float entryTime);
+int getShared(SharedCache SC, char *keyName, float entryTime, OutputStage stage);
+
+
+#endif